@@ -0,0 +1,391 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "analysis.h"
+#include "c8.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+decodedInstruction decode(uint16_t opcode) {
+    decodedInstruction instr;
+    instr.opcode = opcode;
+    instr.nnn = opcode & 0x0FFF;
+    instr.x = (opcode & 0x0F00) >> 8;
+    instr.y = (opcode & 0x00F0) >> 4;
+    instr.nn = opcode & 0x00FF;
+
+    /* same decisions as c8::emulateCycle(), so this is what the core will actually run */
+    instructionKind kind = OP_UNKNOWN;
+    switch(opcode & 0xF000) {
+        case 0x0000:
+            switch(opcode & 0x000F) {
+                case 0x0000: kind = OP_CLS; break;
+                case 0x000E: kind = OP_RET; break;
+                default:     kind = OP_SYS; break;
+            }
+            break;
+        case 0x1000: kind = OP_JP; break;
+        case 0x2000: kind = OP_CALL; break;
+        case 0x3000: kind = OP_SE_NN; break;
+        case 0x4000: kind = OP_SNE_NN; break;
+        case 0x5000: kind = OP_SE_VY; break;
+        case 0x6000: kind = OP_LD_NN; break;
+        case 0x7000: kind = OP_ADD_NN; break;
+        case 0x8000:
+            switch(opcode & 0x000F) {
+                case 0x0000: kind = OP_LD_VY; break;
+                case 0x0001: kind = OP_OR; break;
+                case 0x0002: kind = OP_AND; break;
+                case 0x0003: kind = OP_XOR; break;
+                case 0x0004: kind = OP_ADD_VY; break;
+                case 0x0005: kind = OP_SUB; break;
+                case 0x0006: kind = OP_SHR; break;
+                case 0x0007: kind = OP_SUBN; break;
+                case 0x000E: kind = OP_SHL; break;
+            }
+            break;
+        case 0x9000: kind = OP_SNE_VY; break;
+        case 0xA000: kind = OP_LD_I; break;
+        case 0xB000: kind = OP_JP_V0; break;
+        case 0xC000: kind = OP_RND; break;
+        case 0xD000: kind = OP_DRW; break;
+        case 0xE000:
+            switch(opcode & 0x00FF) {
+                case 0x009E: kind = OP_SKP; break;
+                case 0x00A1: kind = OP_SKNP; break;
+            }
+            break;
+        case 0xF000:
+            switch(opcode & 0x00FF) {
+                case 0x0007: kind = OP_LD_VX_DT; break;
+                case 0x000A: kind = OP_LD_VX_K; break;
+                case 0x0015: kind = OP_LD_DT_VX; break;
+                case 0x0018: kind = OP_LD_ST_VX; break;
+                case 0x001E: kind = OP_ADD_I_VX; break;
+                case 0x0029: kind = OP_LD_F_VX; break;
+                case 0x0033: kind = OP_LD_B_VX; break;
+                case 0x0055: kind = OP_LD_I_VX; break;
+                case 0x0065: kind = OP_LD_VX_I; break;
+            }
+            break;
+    }
+    instr.kind = kind;
+    return instr;
+}
+
+static bool isSkip(const decodedInstruction &instr) {
+    return instr.kind == OP_SE_NN || instr.kind == OP_SNE_NN || instr.kind == OP_SE_VY ||
+           instr.kind == OP_SNE_VY || instr.kind == OP_SKP || instr.kind == OP_SKNP;
+}
+
+bool isBlockEnd(const decodedInstruction &instr) {
+    switch(instr.kind) {
+        case OP_JP:
+        case OP_CALL:
+        case OP_RET:
+        case OP_JP_V0:
+            return true;
+        default:
+            return isSkip(instr);
+    }
+}
+
+uint64_t hashRom(const unsigned char *rom, unsigned int size) {
+    uint64_t hash = 14695981039346656037ULL;
+    for(unsigned int i=0; i<size; i++) {
+        hash ^= rom[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+analysis::analysis() {
+    mapping = nullptr;
+    mappingSize = 0;
+    clear();
+}
+
+analysis::~analysis() {
+    clear();
+}
+
+void analysis::clear() {
+#ifndef _WIN32
+    if(mapping != nullptr) {
+        munmap(mapping, mappingSize);
+    }
+#endif
+    mapping = nullptr;
+    mappingSize = 0;
+
+    ownInstructions.clear();
+    ownBlocks.clear();
+    ownTargets.clear();
+
+    instructions = nullptr;
+    instructionCount = 0;
+    blocks = nullptr;
+    blockCount = 0;
+    jumpTargets = nullptr;
+    targetCount = 0;
+}
+
+static bool inRom(unsigned int addr, unsigned int size) {
+    return addr >= 0x200 && addr + 1 < 0x200 + size;    /* whole instruction is inside the ROM */
+}
+
+void analysis::analyze(const unsigned char *rom, unsigned int size) {
+    clear();
+
+    /* decode at every byte, games do jump to odd addresses */
+    ownInstructions.resize(size);
+    for(unsigned int i=0; i<size; i++) {
+        uint16_t opcode = (rom[i] << 8) | (i + 1 < size ? rom[i+1] : 0);
+        ownInstructions[i] = decode(opcode);
+    }
+
+    /* walk everything reachable from 0x200 and remember where blocks start */
+    std::vector<bool> reached(size, false);
+    std::vector<bool> leader(size, false);
+    std::vector<uint16_t> work;
+
+    if(inRom(0x200, size)) {
+        leader[0] = true;
+        work.push_back(0x200);
+    }
+
+    while(!work.empty()) {
+        unsigned int addr = work.back();
+        work.pop_back();
+
+        while(inRom(addr, size) && !reached[addr - 0x200]) {
+            reached[addr - 0x200] = true;
+            const decodedInstruction &instr = ownInstructions[addr - 0x200];
+
+            unsigned int next[2];
+            int nextCount = 0;
+            if(instr.kind == OP_JP || instr.kind == OP_CALL) {
+                ownTargets.push_back(instr.nnn);
+                next[nextCount++] = instr.nnn;
+                if(instr.kind == OP_CALL) {
+                    next[nextCount++] = addr + 2;   /* where the subroutine returns to */
+                }
+            } else if(isSkip(instr)) {
+                next[nextCount++] = addr + 2;
+                next[nextCount++] = addr + 4;
+            } else if(!isBlockEnd(instr)) {
+                addr += 2;
+                continue;
+            }
+
+            for(int i=0; i<nextCount; i++) {
+                if(inRom(next[i], size)) {
+                    leader[next[i] - 0x200] = true;
+                    work.push_back(next[i]);
+                }
+            }
+            break;
+        }
+    }
+
+    std::sort(ownTargets.begin(), ownTargets.end());
+    ownTargets.erase(std::unique(ownTargets.begin(), ownTargets.end()), ownTargets.end());
+
+    /* a block runs from a leader until it ends itself or runs into the next leader */
+    for(unsigned int i=0; i<size; i++) {
+        if(!leader[i] || !reached[i]) {
+            continue;
+        }
+        basicBlock block;
+        block.start = 0x200 + i;
+        unsigned int addr = block.start;
+        while(true) {
+            bool ends = isBlockEnd(ownInstructions[addr - 0x200]);
+            addr += 2;
+            if(ends || !inRom(addr, size) || !reached[addr - 0x200] || leader[addr - 0x200]) {
+                break;
+            }
+        }
+        block.end = addr;
+        ownBlocks.push_back(block);
+    }
+
+    instructions = ownInstructions.data();
+    instructionCount = ownInstructions.size();
+    blocks = ownBlocks.data();
+    blockCount = ownBlocks.size();
+    jumpTargets = ownTargets.data();
+    targetCount = ownTargets.size();
+}
+
+const decodedInstruction *analysis::at(unsigned short address) const {
+    if(address < 0x200 || address - 0x200u >= instructionCount) {
+        return nullptr;
+    }
+    return &instructions[address - 0x200];
+}
+
+static bool startsBefore(const basicBlock &block, unsigned short address) {
+    return block.start < address;
+}
+
+bool analysis::isBlockStart(unsigned short address) const {
+    const basicBlock *found = std::lower_bound(blocks, blocks + blockCount, address, startsBefore);
+    return found != blocks + blockCount && found->start == address;
+}
+
+bool analysis::isJumpTarget(unsigned short address) const {
+    return std::binary_search(jumpTargets, jumpTargets + targetCount, (uint16_t) address);
+}
+
+static uint32_t align8(uint32_t offset) {
+    return (offset + 7) & ~7u;
+}
+
+/* everything a cache file has to get right before we point into it */
+static bool validCache(const unsigned char *data, size_t length, const unsigned char *rom, unsigned int size) {
+    if(length < sizeof(cacheHeader)) {
+        return false;
+    }
+    const cacheHeader *header = (const cacheHeader *) data;
+    if(memcmp(header->magic, "C8EA", 4) != 0 || header->formatVersion != ANALYSIS_FORMAT_VERSION ||
+       header->coreVersion != C8_CORE_VERSION || header->romSize != size || header->romHash != hashRom(rom, size)) {
+        return false;
+    }
+    if(header->instructionCount != size) {
+        return false;
+    }
+
+    uint64_t instructionEnd = header->instructionOffset + (uint64_t) header->instructionCount * sizeof(decodedInstruction);
+    uint64_t blockEnd = header->blockOffset + (uint64_t) header->blockCount * sizeof(basicBlock);
+    uint64_t targetEnd = header->targetOffset + (uint64_t) header->targetCount * sizeof(uint16_t);
+    return header->instructionOffset % 8 == 0 && header->blockOffset % 8 == 0 && header->targetOffset % 8 == 0 &&
+           instructionEnd <= length && blockEnd <= length && targetEnd <= length;
+}
+
+bool analysis::loadCache(const char *filepath, const unsigned char *rom, unsigned int size) {
+    clear();
+
+#ifndef _WIN32
+    int fd = open(filepath, O_RDONLY);
+    if(fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  /* the mapping stays valid without the descriptor */
+    if(data == MAP_FAILED) {
+        return false;
+    }
+    mapping = data;
+    mappingSize = info.st_size;
+    const unsigned char *bytes = (const unsigned char *) data;
+    size_t length = mappingSize;
+#else
+    /* no mmap here, read the file and keep it in our own tables instead */
+    FILE *file = fopen(filepath, "rb");
+    if(file == nullptr) {
+        return false;
+    }
+    std::vector<unsigned char> contents;
+    unsigned char chunk[4096];
+    size_t bytesRead;
+    while((bytesRead = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        contents.insert(contents.end(), chunk, chunk + bytesRead);
+    }
+    fclose(file);
+    const unsigned char *bytes = contents.data();
+    size_t length = contents.size();
+#endif
+
+    if(!validCache(bytes, length, rom, size)) {
+        clear();
+        return false;
+    }
+
+    const cacheHeader *header = (const cacheHeader *) bytes;
+    instructions = (const decodedInstruction *) (bytes + header->instructionOffset);
+    instructionCount = header->instructionCount;
+    blocks = (const basicBlock *) (bytes + header->blockOffset);
+    blockCount = header->blockCount;
+    jumpTargets = (const uint16_t *) (bytes + header->targetOffset);
+    targetCount = header->targetCount;
+
+#ifdef _WIN32
+    ownInstructions.assign(instructions, instructions + instructionCount);
+    ownBlocks.assign(blocks, blocks + blockCount);
+    ownTargets.assign(jumpTargets, jumpTargets + targetCount);
+    instructions = ownInstructions.data();
+    blocks = ownBlocks.data();
+    jumpTargets = ownTargets.data();
+#endif
+    return true;
+}
+
+bool analysis::saveCache(const char *filepath, const unsigned char *rom, unsigned int size) const {
+    cacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "C8EA", 4);
+    header.formatVersion = ANALYSIS_FORMAT_VERSION;
+    header.coreVersion = C8_CORE_VERSION;
+    header.romSize = size;
+    header.romHash = hashRom(rom, size);
+    header.instructionCount = instructionCount;
+    header.blockCount = blockCount;
+    header.targetCount = targetCount;
+    header.instructionOffset = align8(sizeof(header));
+    header.blockOffset = align8(header.instructionOffset + instructionCount * sizeof(decodedInstruction));
+    header.targetOffset = align8(header.blockOffset + blockCount * sizeof(basicBlock));
+    uint32_t length = header.targetOffset + targetCount * sizeof(uint16_t);
+
+    std::vector<unsigned char> contents(length, 0);
+    /* empty tables are skipped, their offset can be the end of the file and their pointer null */
+    memcpy(contents.data(), &header, sizeof(header));
+    if(instructionCount > 0) {
+        memcpy(contents.data() + header.instructionOffset, instructions, instructionCount * sizeof(decodedInstruction));
+    }
+    if(blockCount > 0) {
+        memcpy(contents.data() + header.blockOffset, blocks, blockCount * sizeof(basicBlock));
+    }
+    if(targetCount > 0) {
+        memcpy(contents.data() + header.targetOffset, jumpTargets, targetCount * sizeof(uint16_t));
+    }
+
+    /* write next to it and rename, so other instances never map a half written file */
+    std::string temporary = std::string(filepath) + ".tmp";
+#ifndef _WIN32
+    temporary += std::to_string((long long) getpid());
+#endif
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if(file == nullptr) {
+        return false;
+    }
+    bool written = fwrite(contents.data(), 1, length, file) == length;
+    written = fclose(file) == 0 && written;
+    if(!written) {
+        remove(temporary.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    remove(filepath);   /* rename doesn't replace existing files here */
+#endif
+    if(rename(temporary.c_str(), filepath) != 0) {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::string analysis::cachePath(const char *directory, const unsigned char *rom, unsigned int size) {
+    char name[64];
+    snprintf(name, sizeof(name), "%016llx-v%d.c8a", (unsigned long long) hashRom(rom, size), C8_CORE_VERSION);
+    return std::string(directory) + "/" + name;
+}
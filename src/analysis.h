@@ -0,0 +1,124 @@
+#ifndef C8E_ANALYSIS_H
+#define C8E_ANALYSIS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Bump whenever the cache file layout below changes */
+#define ANALYSIS_FORMAT_VERSION 1
+
+/* What an opcode does, named after the usual CHIP-8 mnemonics */
+enum instructionKind {
+    OP_UNKNOWN = 0,
+    OP_SYS,         /* 0NNN */
+    OP_CLS,         /* 00E0 */
+    OP_RET,         /* 00EE */
+    OP_JP,          /* 1NNN */
+    OP_CALL,        /* 2NNN */
+    OP_SE_NN,       /* 3XNN */
+    OP_SNE_NN,      /* 4XNN */
+    OP_SE_VY,       /* 5XY0 */
+    OP_LD_NN,       /* 6XNN */
+    OP_ADD_NN,      /* 7XNN */
+    OP_LD_VY,       /* 8XY0 */
+    OP_OR,          /* 8XY1 */
+    OP_AND,         /* 8XY2 */
+    OP_XOR,         /* 8XY3 */
+    OP_ADD_VY,      /* 8XY4 */
+    OP_SUB,         /* 8XY5 */
+    OP_SHR,         /* 8XY6 */
+    OP_SUBN,        /* 8XY7 */
+    OP_SHL,         /* 8XYE */
+    OP_SNE_VY,      /* 9XY0 */
+    OP_LD_I,        /* ANNN */
+    OP_JP_V0,       /* BNNN */
+    OP_RND,         /* CXNN */
+    OP_DRW,         /* DXYN */
+    OP_SKP,         /* EX9E */
+    OP_SKNP,        /* EXA1 */
+    OP_LD_VX_DT,    /* FX07 */
+    OP_LD_VX_K,     /* FX0A */
+    OP_LD_DT_VX,    /* FX15 */
+    OP_LD_ST_VX,    /* FX18 */
+    OP_ADD_I_VX,    /* FX1E */
+    OP_LD_F_VX,     /* FX29 */
+    OP_LD_B_VX,     /* FX33 */
+    OP_LD_I_VX,     /* FX55 */
+    OP_LD_VX_I,     /* FX65 */
+    OP_KIND_COUNT
+};
+
+/* The structs below are written to the cache file as they are, so they only hold fixed size fields */
+struct decodedInstruction {
+    uint16_t opcode;
+    uint16_t nnn;       /* lowest 12 bits */
+    uint8_t kind;       /* instructionKind */
+    uint8_t x;          /* second nibble */
+    uint8_t y;          /* third nibble */
+    uint8_t nn;         /* lowest 8 bits, the lowest 4 are N */
+};
+
+struct basicBlock {
+    uint16_t start;     /* address of the first instruction */
+    uint16_t end;       /* address right after the last instruction */
+};
+
+struct cacheHeader {
+    char magic[4];              /* "C8EA" */
+    uint32_t formatVersion;     /* ANALYSIS_FORMAT_VERSION */
+    uint32_t coreVersion;       /* C8_CORE_VERSION */
+    uint32_t romSize;
+    uint64_t romHash;
+    uint32_t instructionOffset; /* byte offsets from the start of the file */
+    uint32_t instructionCount;
+    uint32_t blockOffset;
+    uint32_t blockCount;
+    uint32_t targetOffset;
+    uint32_t targetCount;
+};
+
+decodedInstruction decode(uint16_t opcode);
+bool isBlockEnd(const decodedInstruction &instr); /* jumps, calls, returns and skips end a basic block */
+uint64_t hashRom(const unsigned char *rom, unsigned int size);   /* FNV-1a */
+
+/* Static view of a ROM: every address decoded, the basic blocks reachable from 0x200 and all JP/CALL targets.
+ * It's computed from the ROM as loaded, so code the game writes into memory at runtime isn't covered.
+ * The tables either live in this object (analyze) or point straight into a mapped cache file (loadCache). */
+class analysis {
+    public:
+    const decodedInstruction *instructions;    /* instructions[addr - 0x200] for every byte of the ROM */
+    unsigned int instructionCount;
+    const basicBlock *blocks;                  /* sorted by start */
+    unsigned int blockCount;
+    const uint16_t *jumpTargets;               /* sorted, no duplicates */
+    unsigned int targetCount;
+
+    analysis();
+    ~analysis();
+    analysis(const analysis &) = delete;
+    analysis &operator=(const analysis &) = delete;
+
+    void analyze(const unsigned char *rom, unsigned int size);
+    bool loadCache(const char *filepath, const unsigned char *rom, unsigned int size);
+    bool saveCache(const char *filepath, const unsigned char *rom, unsigned int size) const;
+
+    const decodedInstruction *at(unsigned short address) const;  /* null outside the ROM */
+    bool isBlockStart(unsigned short address) const;
+    bool isJumpTarget(unsigned short address) const;
+
+    static std::string cachePath(const char *directory, const unsigned char *rom, unsigned int size);
+
+    private:
+    std::vector<decodedInstruction> ownInstructions;
+    std::vector<basicBlock> ownBlocks;
+    std::vector<uint16_t> ownTargets;
+
+    void *mapping;      /* the mapped cache file, if we came from one */
+    size_t mappingSize;
+
+    void clear();
+};
+
+#endif //C8E_ANALYSIS_H
@@ -2,6 +2,7 @@
 #include <random>
 #include <iostream>
 #include "c8.h"
+#include "debugger.h"
 
 unsigned char chip8_fontset[80] =
         {
@@ -24,7 +25,7 @@ unsigned char chip8_fontset[80] =
         };
 
 c8::c8() {
-    /* empty for now */
+    attachedDebugger = nullptr;
 }
 
 c8::~c8() {
@@ -38,6 +39,7 @@ void c8::initialize() {
     opcode = 0; /* reset opcode */
     I = 0; /* reset address register */
     sp = 0; /* reset stack pointer */
+    romSize = 0;
 
     for(int i=0; i<2048; i++) {
         gfx[i] = 0;     /* reset display */
@@ -60,7 +62,7 @@ void c8::initialize() {
     delayTimer = 0;
     soundTimer = 0;
 
-    srand(time(nullptr));   /* initialize seed for random */
+    randomEngine.seed(time(nullptr));   /* initialize seed for random */
 }
 
 bool c8::load(const char *filepath) {
@@ -105,11 +107,51 @@ bool c8::load(const char *filepath) {
 
     free(rom); /* free binary rom allocated */
     fclose(file); /* close file */
+    romSize = numBytes;
 
     return true;
 }
 
+const unsigned char *c8::rom() const {
+    return &memory[512];
+}
+
+unsigned short c8::romLength() const {
+    return romSize;
+}
+
+template<bool Debug>
+unsigned char c8::readMemory(unsigned short address) {
+    if(Debug && attachedDebugger != nullptr) {
+        attachedDebugger->memoryRead(address);
+    }
+    return memory[address];
+}
+
+template<bool Debug>
+void c8::writeMemory(unsigned short address, unsigned char value) {
+    if(Debug && attachedDebugger != nullptr) {
+        attachedDebugger->memoryWrite(address);
+    }
+    memory[address] = value;
+}
+
+template<bool Debug>
+void c8::unknownOpcode() {
+    /* print opcode in hexadecimal */
+    printf("Unknown opcode: 0x%X\n", opcode);
+    if(Debug && attachedDebugger != nullptr) {
+        attachedDebugger->unknownOpcode(pc, opcode);
+    }
+    pc += 2;    /* skip it, otherwise we'd be stuck on it forever */
+}
+
 void c8::emulateCycle() {
+    execute<false>();
+}
+
+template<bool Debug>
+void c8::execute() {
     /* First we fetch the opcode which is in memory */
     opcode = (memory[pc] << 8) | (memory[pc+1]);
 
@@ -133,8 +175,7 @@ void c8::emulateCycle() {
                     break;
 
                 default:
-                    /* print opcode in hexadecimal */
-                    printf("Unknown opcode 0x%X\n", opcode);
+                    unknownOpcode<Debug>();
             }
             break;
         }
@@ -266,8 +307,7 @@ void c8::emulateCycle() {
                 }
 
                 default:
-                    /* print opcode in hexadecimal */
-                    printf("Unknown opcode: 0x%X\n", opcode);
+                    unknownOpcode<Debug>();
             }
             break;
         }
@@ -293,7 +333,7 @@ void c8::emulateCycle() {
         }
 
         case 0xC000: {    /* if the first 4 bits is C, 0xCXNN: set VX = rand() & NN. rand() should be 0-255 (8bits). */
-            V[(opcode & 0x0F00) >> 8] = (rand() % 256) & (opcode & 0x00FF); /* 0-255 is 8 bits AND with 8 bits */
+            V[(opcode & 0x0F00) >> 8] = (randomEngine() % 256) & (opcode & 0x00FF); /* 0-255 is 8 bits AND with 8 bits */
             pc += 2;
             break;
         }
@@ -308,7 +348,7 @@ void c8::emulateCycle() {
 
             V[0xF] = 0;
             for (int i = 0; i < height; i++) {
-                pixel = memory[I + i];
+                pixel = readMemory<Debug>(I + i);
                 for (int j = 0; j < 8; j++) {
                     if ((pixel & (0x80 >> j)) != 0) {    /* if sprite pixel bit we want to draw is 1 */
                         if (gfx[x + j + ((y + i) * 64)] == 1) {   /* AND the pixel bit at the screen is 1 */
@@ -344,7 +384,7 @@ void c8::emulateCycle() {
                 }
 
                 default:
-                    printf("Unknown opcode: 0x%X\n", opcode);
+                    unknownOpcode<Debug>();
             }
             break;
         }
@@ -405,16 +445,16 @@ void c8::emulateCycle() {
                 }
 
                 case 0x0033: {  /* 0xFX33 */
-                    memory[I] = V[(opcode & 0x0F00) >> 8] / 100;
-                    memory[I+1] = (V[(opcode & 0x0F00) >> 8] / 10) % 10;
-                    memory[I+2] = V[(opcode & 0x0F00) >> 8] % 10;
+                    writeMemory<Debug>(I, V[(opcode & 0x0F00) >> 8] / 100);
+                    writeMemory<Debug>(I+1, (V[(opcode & 0x0F00) >> 8] / 10) % 10);
+                    writeMemory<Debug>(I+2, V[(opcode & 0x0F00) >> 8] % 10);
                     pc += 2;
                     break;
                 }
 
                 case 0x0055: { /* 0xFX55: reg_dump to mem */
                     for(int i=0; i<= ((opcode & 0x0F00) >> 8); i++) {
-                        memory[I + i] = V[i];
+                        writeMemory<Debug>(I + i, V[i]);
                     }
                     I += ((opcode & 0x0F00) >> 8) + 1;
                     pc += 2;
@@ -423,19 +463,21 @@ void c8::emulateCycle() {
 
                 case 0x0065: { /* 0xFX65: reg_load from mem */
                     for (int i = 0; i <= ((opcode & 0x0F00) >> 8); i++) {
-                        V[i] = memory[I + i];
+                        V[i] = readMemory<Debug>(I + i);
                     }
                     I += ((opcode & 0x0F00) >> 8) + 1;
                     pc += 2;
                     break;
                 }
+
+                default:
+                    unknownOpcode<Debug>();
             }
             break;
         }
 
         default:
-            /* print opcode in hexadecimal */
-            printf("Unknown opcode: 0x%X\n", opcode);
+            unknownOpcode<Debug>();
     }
 
     /* update timers */
@@ -452,4 +494,7 @@ void c8::emulateCycle() {
 
 
 
-}
\ No newline at end of file
+}
+
+/* the debugger runs the instrumented core from another translation unit */
+template void c8::execute<true>();
@@ -1,6 +1,14 @@
 #ifndef C8E_C8_H
 #define C8E_C8_H
 
+#include <random>
+
+/* Bump whenever the core or the ROM analysis changes behaviour, it keys the on-disk analysis cache */
+#define C8_CORE_VERSION 2
+
+class debugger;
+
+/* The whole machine state is plain data, so saving it is copying the object and rolling back is assigning it back */
 class c8 {
     private:
     unsigned short opcode;  /* This is 16 bits (2 bytes) opcode */
@@ -20,6 +28,22 @@ class c8 {
     unsigned short stack[16];
     unsigned short sp;
 
+    /* Random generator for 0xCXNN lives in the machine (not rand()) so a copy of the machine replays the same numbers */
+    std::minstd_rand randomEngine;
+
+    unsigned short romSize; /* bytes of ROM loaded at 0x200 */
+
+    /* Only looked at by the Debug instantiation of execute(), emulateCycle() never touches it */
+    debugger *attachedDebugger;
+    friend class debugger;
+
+    /* One fetch-execute cycle. execute<false> is the plain fast path,
+       execute<true> reports memory accesses and bad opcodes to attachedDebugger. Both share the same state. */
+    template<bool Debug> void execute();
+    template<bool Debug> unsigned char readMemory(unsigned short address);
+    template<bool Debug> void writeMemory(unsigned short address, unsigned char value);
+    template<bool Debug> void unknownOpcode();
+
     /* We also need a hex keyboard input */
     /* Keyboard will look the following:
      * 1    2   3   C
@@ -41,6 +65,9 @@ class c8 {
     void emulateCycle(); /* emulates fetch-execute cycle of chip-8 */
     bool load(const char *filepath); /* loads the ROM binary to memory */
 
+    const unsigned char *rom() const; /* the ROM as loaded at 0x200 */
+    unsigned short romLength() const;
+
 };
 
 
@@ -0,0 +1,407 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include "debugger.h"
+
+/* step over/out give up after this many cycles so a game that never returns doesn't hang the prompt */
+#define MAX_STEP_CYCLES 1000000
+
+static const char *reasonNames[] = {
+        "running",
+        "paused",
+        "step",
+        "breakpoint",
+        "read watchpoint",
+        "write watchpoint",
+        "I changed",
+        "register changed",
+        "unknown opcode",
+        "cycle limit"
+};
+
+std::string disassemble(const decodedInstruction &instr) {
+    char text[32];
+    switch(instr.kind) {
+        case OP_SYS:      snprintf(text, sizeof(text), "SYS 0x%03X", instr.nnn); break;
+        case OP_CLS:      snprintf(text, sizeof(text), "CLS"); break;
+        case OP_RET:      snprintf(text, sizeof(text), "RET"); break;
+        case OP_JP:       snprintf(text, sizeof(text), "JP 0x%03X", instr.nnn); break;
+        case OP_CALL:     snprintf(text, sizeof(text), "CALL 0x%03X", instr.nnn); break;
+        case OP_SE_NN:    snprintf(text, sizeof(text), "SE V%X, 0x%02X", instr.x, instr.nn); break;
+        case OP_SNE_NN:   snprintf(text, sizeof(text), "SNE V%X, 0x%02X", instr.x, instr.nn); break;
+        case OP_SE_VY:    snprintf(text, sizeof(text), "SE V%X, V%X", instr.x, instr.y); break;
+        case OP_LD_NN:    snprintf(text, sizeof(text), "LD V%X, 0x%02X", instr.x, instr.nn); break;
+        case OP_ADD_NN:   snprintf(text, sizeof(text), "ADD V%X, 0x%02X", instr.x, instr.nn); break;
+        case OP_LD_VY:    snprintf(text, sizeof(text), "LD V%X, V%X", instr.x, instr.y); break;
+        case OP_OR:       snprintf(text, sizeof(text), "OR V%X, V%X", instr.x, instr.y); break;
+        case OP_AND:      snprintf(text, sizeof(text), "AND V%X, V%X", instr.x, instr.y); break;
+        case OP_XOR:      snprintf(text, sizeof(text), "XOR V%X, V%X", instr.x, instr.y); break;
+        case OP_ADD_VY:   snprintf(text, sizeof(text), "ADD V%X, V%X", instr.x, instr.y); break;
+        case OP_SUB:      snprintf(text, sizeof(text), "SUB V%X, V%X", instr.x, instr.y); break;
+        case OP_SHR:      snprintf(text, sizeof(text), "SHR V%X", instr.x); break;
+        case OP_SUBN:     snprintf(text, sizeof(text), "SUBN V%X, V%X", instr.x, instr.y); break;
+        case OP_SHL:      snprintf(text, sizeof(text), "SHL V%X", instr.x); break;
+        case OP_SNE_VY:   snprintf(text, sizeof(text), "SNE V%X, V%X", instr.x, instr.y); break;
+        case OP_LD_I:     snprintf(text, sizeof(text), "LD I, 0x%03X", instr.nnn); break;
+        case OP_JP_V0:    snprintf(text, sizeof(text), "JP V0, 0x%03X", instr.nnn); break;
+        case OP_RND:      snprintf(text, sizeof(text), "RND V%X, 0x%02X", instr.x, instr.nn); break;
+        case OP_DRW:      snprintf(text, sizeof(text), "DRW V%X, V%X, %d", instr.x, instr.y, instr.nn & 0xF); break;
+        case OP_SKP:      snprintf(text, sizeof(text), "SKP V%X", instr.x); break;
+        case OP_SKNP:     snprintf(text, sizeof(text), "SKNP V%X", instr.x); break;
+        case OP_LD_VX_DT: snprintf(text, sizeof(text), "LD V%X, DT", instr.x); break;
+        case OP_LD_VX_K:  snprintf(text, sizeof(text), "LD V%X, K", instr.x); break;
+        case OP_LD_DT_VX: snprintf(text, sizeof(text), "LD DT, V%X", instr.x); break;
+        case OP_LD_ST_VX: snprintf(text, sizeof(text), "LD ST, V%X", instr.x); break;
+        case OP_ADD_I_VX: snprintf(text, sizeof(text), "ADD I, V%X", instr.x); break;
+        case OP_LD_F_VX:  snprintf(text, sizeof(text), "LD F, V%X", instr.x); break;
+        case OP_LD_B_VX:  snprintf(text, sizeof(text), "LD B, V%X", instr.x); break;
+        case OP_LD_I_VX:  snprintf(text, sizeof(text), "LD [I], V%X", instr.x); break;
+        case OP_LD_VX_I:  snprintf(text, sizeof(text), "LD V%X, [I]", instr.x); break;
+        default:          snprintf(text, sizeof(text), "DW 0x%04X", instr.opcode); break;
+    }
+    return text;
+}
+
+debugger::debugger(c8 &machine) : machine(machine) {
+    reason = STOP_NONE;
+    stopAddress = 0;
+    watchAddress = 0;
+    badOpcode = 0;
+    iWatched = false;
+    watchedRegisters = 0;
+    resuming = false;
+    romAnalysis = nullptr;
+}
+
+debugger::~debugger() {
+    detach();
+}
+
+void debugger::attach() {
+    machine.attachedDebugger = this;
+}
+
+void debugger::detach() {
+    if(machine.attachedDebugger == this) {
+        machine.attachedDebugger = nullptr;
+    }
+    resuming = false;
+}
+
+bool debugger::attached() const {
+    return machine.attachedDebugger == this;
+}
+
+void debugger::pause() {
+    attach();
+    reason = STOP_PAUSE;
+    stopAddress = machine.pc;
+}
+
+void debugger::addBreakpoint(unsigned short address) {
+    breakpoints.insert(address);
+}
+
+void debugger::removeBreakpoint(unsigned short address) {
+    breakpoints.erase(address);
+}
+
+void debugger::addWatchpoint(unsigned short address, unsigned short length, bool onRead, bool onWrite) {
+    watchpoint watch;
+    watch.address = address;
+    watch.length = length;
+    watch.onRead = onRead;
+    watch.onWrite = onWrite;
+    watchpoints.push_back(watch);
+}
+
+void debugger::removeWatchpoint(unsigned short address) {
+    for(size_t i=0; i<watchpoints.size(); i++) {
+        if(watchpoints[i].address == address) {
+            watchpoints.erase(watchpoints.begin() + i);
+            return;
+        }
+    }
+}
+
+void debugger::watchI(bool enabled) {
+    iWatched = enabled;
+}
+
+void debugger::watchRegister(int index, bool enabled) {
+    if(enabled) {
+        watchedRegisters |= 1 << index;
+    } else {
+        watchedRegisters &= ~(1 << index);
+    }
+}
+
+bool debugger::watched(unsigned short address, bool write) const {
+    for(size_t i=0; i<watchpoints.size(); i++) {
+        const watchpoint &watch = watchpoints[i];
+        if(address >= watch.address && address < watch.address + watch.length && (write ? watch.onWrite : watch.onRead)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void debugger::memoryRead(unsigned short address) {
+    if(reason == STOP_NONE && watched(address, false)) {
+        reason = STOP_READ_WATCH;
+        watchAddress = address;
+    }
+}
+
+void debugger::memoryWrite(unsigned short address) {
+    if(reason == STOP_NONE && watched(address, true)) {
+        reason = STOP_WRITE_WATCH;
+        watchAddress = address;
+    }
+}
+
+void debugger::unknownOpcode(unsigned short address, unsigned short opcode) {
+    if(reason == STOP_NONE) {
+        reason = STOP_UNKNOWN_OPCODE;
+        stopAddress = address;
+        badOpcode = opcode;
+    }
+}
+
+stopReason debugger::executeOne() {
+    /* register and I watches compare before and after, memory watches come in through the hooks */
+    unsigned char registers[16];
+    memcpy(registers, machine.V, sizeof(registers));
+    unsigned short previousI = machine.I;
+
+    reason = STOP_NONE;
+    stopAddress = machine.pc;
+    machine.execute<true>();
+
+    if(reason != STOP_NONE) {
+        return reason;
+    }
+    if(iWatched && machine.I != previousI) {
+        return reason = STOP_I_WATCH;
+    }
+    for(int i=0; i<16; i++) {
+        if((watchedRegisters & (1 << i)) && machine.V[i] != registers[i]) {
+            watchAddress = i;
+            return reason = STOP_REGISTER_WATCH;
+        }
+    }
+    return STOP_NONE;
+}
+
+stopReason debugger::cycle() {
+    if(!resuming && breakpoints.count(machine.pc) != 0) {
+        resuming = true;    /* so the next cycle runs the instruction instead of stopping again */
+        stopAddress = machine.pc;
+        return reason = STOP_BREAKPOINT;
+    }
+    resuming = false;
+    return executeOne();
+}
+
+stopReason debugger::step() {
+    resuming = false;
+    if(executeOne() == STOP_NONE) {
+        reason = STOP_STEP;
+    }
+    return reason;
+}
+
+stopReason debugger::runUntil(unsigned short sp, unsigned short pc, bool anyPc) {
+    resuming = false;
+    stopReason result = executeOne();
+    for(int n=0; result == STOP_NONE; n++) {
+        if(machine.sp == sp && (anyPc || machine.pc == pc)) {
+            return reason = STOP_STEP;
+        }
+        if(n >= MAX_STEP_CYCLES) {
+            return reason = STOP_CYCLE_LIMIT;
+        }
+        result = cycle();
+    }
+    return result;
+}
+
+stopReason debugger::stepOver() {
+    unsigned short opcode = (machine.memory[machine.pc] << 8) | machine.memory[(machine.pc + 1) & 0xFFF];
+    if(decode(opcode).kind != OP_CALL) {
+        return step();
+    }
+    return runUntil(machine.sp, machine.pc + 2, false);
+}
+
+stopReason debugger::stepOut() {
+    if(machine.sp == 0) {
+        return step();  /* not in a subroutine */
+    }
+    return runUntil(machine.sp - 1, 0, true);
+}
+
+void debugger::useAnalysis(const analysis *tables) {
+    romAnalysis = tables;
+}
+
+std::string debugger::disassemble(unsigned short address) const {
+    address &= 0xFFF;
+    unsigned short opcode = (machine.memory[address] << 8) | machine.memory[(address + 1) & 0xFFF];
+
+    /* the cached decode is only good as long as the game hasn't rewritten that instruction */
+    const decodedInstruction *cached = romAnalysis != nullptr ? romAnalysis->at(address) : nullptr;
+    decodedInstruction instr = cached != nullptr && cached->opcode == opcode ? *cached : decode(opcode);
+
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "%s%c 0x%03X: %04X  ", address == machine.pc ? "=>" : "  ",
+             breakpoints.count(address) != 0 ? '*' : ' ', address, opcode);
+    std::string line = prefix + ::disassemble(instr);
+
+    if(romAnalysis != nullptr && romAnalysis->isJumpTarget(address)) {
+        line += "    ; jump target";
+    } else if(romAnalysis != nullptr && romAnalysis->isBlockStart(address)) {
+        line += "    ; block";
+    }
+    return line;
+}
+
+void debugger::printState() const {
+    printf("PC 0x%03X  I 0x%03X  SP %d  DT %d  ST %d\n", machine.pc, machine.I, machine.sp,
+           machine.delayTimer, machine.soundTimer);
+    for(int i=0; i<16; i++) {
+        printf("V%X %02X%s", i, machine.V[i], i % 8 == 7 ? "\n" : "  ");
+    }
+    if(machine.sp > 0) {
+        printf("stack:");
+        for(int i=machine.sp - 1; i>=0; i--) {
+            printf(" 0x%03X", machine.stack[i]);
+        }
+        printf("\n");
+    }
+}
+
+static void printHelp() {
+    printf("c                  continue\n"
+           "s                  step\n"
+           "n                  step over calls\n"
+           "f                  step out of the current call\n"
+           "b ADDR / db ADDR   add / delete breakpoint\n"
+           "w ADDR [LEN] [r|w|rw] / dw ADDR   add / delete memory watchpoint (LEN in hex, default 1 rw)\n"
+           "wi                 toggle watching I\n"
+           "wv X               toggle watching register VX\n"
+           "r                  registers\n"
+           "x [ADDR] [COUNT]   disassemble\n"
+           "bl                 list the ROM's basic blocks\n"
+           "q                  detach and run the fast core\n");
+}
+
+void debugger::console() {
+    printf("Stopped (%s) at 0x%03X", reasonNames[reason], stopAddress);
+    if(reason == STOP_READ_WATCH || reason == STOP_WRITE_WATCH) {
+        printf(", address 0x%03X", watchAddress);
+    } else if(reason == STOP_REGISTER_WATCH) {
+        printf(", V%X", watchAddress);
+    } else if(reason == STOP_UNKNOWN_OPCODE) {
+        printf(", opcode 0x%04X", badOpcode);
+    }
+    printf("\n");
+    printState();
+    printf("%s\n", disassemble(machine.pc).c_str());
+
+    std::string line;
+    while(true) {
+        printf("(c8db) ");
+        fflush(stdout);
+        if(!std::getline(std::cin, line)) {
+            detach();   /* no one to talk to, just keep playing */
+            return;
+        }
+
+        std::istringstream words(line);
+        std::string command;
+        words >> command;
+
+        if(command == "c") {
+            resuming = true;    /* like gdb, continuing never stops on the breakpoint we're sitting on */
+            return;
+        } else if(command == "q") {
+            detach();
+            return;
+        } else if(command == "s" || command == "n" || command == "f") {
+            stopReason result = command == "s" ? step() : command == "n" ? stepOver() : stepOut();
+            if(result != STOP_STEP) {
+                printf("Stopped (%s) at 0x%03X\n", reasonNames[result], stopAddress);
+            }
+            printf("%s\n", disassemble(machine.pc).c_str());
+        } else if(command == "b" || command == "db" || command == "dw") {
+            std::string address;
+            if(!(words >> address)) {
+                printf("Need an address\n");
+                continue;
+            }
+            unsigned short value = (unsigned short) strtoul(address.c_str(), nullptr, 16);
+            if(command == "b") {
+                addBreakpoint(value);
+            } else if(command == "db") {
+                removeBreakpoint(value);
+            } else {
+                removeWatchpoint(value);
+            }
+        } else if(command == "w") {
+            std::string address, length = "1", mode = "rw";
+            if(!(words >> address)) {
+                printf("Need an address\n");
+                continue;
+            }
+            words >> length >> mode;
+            unsigned short bytes = (unsigned short) strtoul(length.c_str(), nullptr, 16);
+            if(bytes == 0) {
+                printf("Length has to be at least 1\n");
+                continue;
+            }
+            addWatchpoint((unsigned short) strtoul(address.c_str(), nullptr, 16), bytes,
+                          mode.find('r') != std::string::npos, mode.find('w') != std::string::npos);
+        } else if(command == "wi") {
+            iWatched = !iWatched;
+            printf("Watching I: %s\n", iWatched ? "on" : "off");
+        } else if(command == "wv") {
+            std::string index;
+            if(!(words >> index)) {
+                printf("Need a register\n");
+                continue;
+            }
+            int reg = (int) strtoul(index.c_str(), nullptr, 16) & 0xF;
+            bool enabled = (watchedRegisters & (1 << reg)) == 0;
+            watchRegister(reg, enabled);
+            printf("Watching V%X: %s\n", reg, enabled ? "on" : "off");
+        } else if(command == "r") {
+            printState();
+        } else if(command == "x") {
+            std::string address, count = "8";
+            unsigned short start = machine.pc;
+            if(words >> address) {
+                start = (unsigned short) strtoul(address.c_str(), nullptr, 16);
+            }
+            words >> count;
+            int lines = atoi(count.c_str());
+            for(int i=0; i<lines; i++) {
+                printf("%s\n", disassemble(start + i * 2).c_str());
+            }
+        } else if(command == "bl") {
+            if(romAnalysis == nullptr) {
+                printf("No ROM analysis\n");
+                continue;
+            }
+            for(unsigned int i=0; i<romAnalysis->blockCount; i++) {
+                const basicBlock &block = romAnalysis->blocks[i];
+                printf("0x%03X-0x%03X%s\n", block.start, block.end,
+                       romAnalysis->isJumpTarget(block.start) ? "  jump target" : "");
+            }
+        } else if(!command.empty()) {
+            printHelp();
+        }
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef C8E_DEBUGGER_H
+#define C8E_DEBUGGER_H
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+#include "analysis.h"
+#include "c8.h"
+
+/* Why the debugger handed control back */
+enum stopReason {
+    STOP_NONE = 0,          /* keep running */
+    STOP_PAUSE,             /* asked to from outside */
+    STOP_STEP,              /* step, step over or step out finished */
+    STOP_BREAKPOINT,        /* about to execute a breakpoint address */
+    STOP_READ_WATCH,        /* last instruction read a watched byte of memory */
+    STOP_WRITE_WATCH,       /* last instruction wrote a watched byte of memory */
+    STOP_I_WATCH,           /* last instruction changed I */
+    STOP_REGISTER_WATCH,    /* last instruction changed a watched V register */
+    STOP_UNKNOWN_OPCODE,    /* last instruction couldn't be decoded, the core skipped it */
+    STOP_CYCLE_LIMIT        /* step over/out gave up */
+};
+
+/* Breakpoints, watchpoints and stepping on top of c8::execute<true>.
+ * While attached, cycles go through the instrumented core, detached the machine runs emulateCycle() as usual.
+ * Both work on the same c8, so attaching or detaching at any point keeps the machine state as it is. */
+class debugger {
+    public:
+    stopReason reason;
+    unsigned short stopAddress;     /* instruction that caused the last stop */
+    unsigned short watchAddress;    /* memory address or V register index that triggered a watch */
+    unsigned short badOpcode;       /* opcode behind the last STOP_UNKNOWN_OPCODE */
+
+    explicit debugger(c8 &machine);
+    ~debugger();
+
+    void attach();
+    void detach();
+    bool attached() const;
+    void pause();           /* attaches and stops before the next instruction */
+
+    void addBreakpoint(unsigned short address);
+    void removeBreakpoint(unsigned short address);
+    void addWatchpoint(unsigned short address, unsigned short length, bool onRead, bool onWrite);
+    void removeWatchpoint(unsigned short address);
+    void watchI(bool enabled);
+    void watchRegister(int index, bool enabled);
+
+    stopReason cycle();     /* one cycle of normal running, stops at breakpoints */
+    stopReason step();
+    stopReason stepOver();  /* steps over 0x2NNN calls */
+    stopReason stepOut();   /* runs until the current subroutine returns */
+
+    void useAnalysis(const analysis *tables);   /* ROM analysis for the disassembler, may be null */
+    std::string disassemble(unsigned short address) const;
+    void printState() const;
+    void console();         /* interactive prompt on stdin, returns on continue or detach */
+
+    /* hooks for c8::execute<true> */
+    void memoryRead(unsigned short address);
+    void memoryWrite(unsigned short address);
+    void unknownOpcode(unsigned short address, unsigned short opcode);
+
+    private:
+    struct watchpoint {
+        unsigned short address;
+        unsigned short length;
+        bool onRead;
+        bool onWrite;
+    };
+
+    c8 &machine;
+    std::set<unsigned short> breakpoints;
+    std::vector<watchpoint> watchpoints;
+    bool iWatched;
+    uint16_t watchedRegisters;  /* bit per V register */
+    bool resuming;              /* don't stop at the breakpoint we're sitting on */
+    const analysis *romAnalysis;
+
+    stopReason executeOne();
+    stopReason runUntil(unsigned short sp, unsigned short pc, bool anyPc);
+    bool watched(unsigned short address, bool write) const;
+};
+
+std::string disassemble(const decodedInstruction &instr);
+
+#endif //C8E_DEBUGGER_H
@@ -1,5 +1,12 @@
 #include "c8.h"
+#include "analysis.h"
+#include "debugger.h"
+#include "profiler.h"
+#include "runahead.h"
 #include <iostream>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
 #ifdef __APPLE__
 #include <OpenGL/gl.h>
 #include <OpenGL/glu.h>
@@ -19,6 +26,26 @@
 c8 myChip8;
 int modifier = 10;
 
+// Frame timing
+profiler myProfiler;
+const char *profilePath = nullptr;
+bool showOverlay = false;
+volatile sig_atomic_t dumpRequested = 0;
+
+// Run-ahead
+c8 aheadChip8;
+int runAheadFrames = 0;
+bool runAheadAuto = false;
+
+// ROM analysis, cached on disk between runs
+analysis myAnalysis;
+const char *cacheDir = nullptr;
+
+// Debugger, runs the instrumented core only while attached
+debugger myDebugger(myChip8);
+bool debugBreak = false;
+bool analysisReady = false;
+
 // Window size
 int display_width = SCREEN_WIDTH * modifier;
 int display_height = SCREEN_HEIGHT * modifier;
@@ -27,6 +54,11 @@ void display();
 void reshape_window(GLsizei w, GLsizei h);
 void keyboardUp(unsigned char key, int x, int y);
 void keyboardDown(unsigned char key, int x, int y);
+void dumpProfile();
+void requestDump(int signum);
+void drawOverlay();
+void reportRunAhead();
+void prepareAnalysis();
 
 // Use new drawing method
 #define DRAWWITHTEXTURE
@@ -36,15 +68,80 @@ void setupTexture();
 
 int main(int argc, char **argv)
 {
+    profiler::timePoint startup = profiler::now();
+
     if(argc < 2)
     {
-        printf("Usage: myChip8.exe chip8application\n\n");
+        printf("Usage: myChip8.exe chip8application [--profile out.json] [--overlay] [--runahead [frames]] [--cache dir] [--debug]\n\n");
         return 1;
     }
 
+    for(int i = 2; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+            profilePath = argv[++i];
+        else if(strcmp(argv[i], "--overlay") == 0)
+            showOverlay = true;
+        else if(strcmp(argv[i], "--debug") == 0)
+            debugBreak = true;
+        else if(strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+            cacheDir = argv[++i];
+        else if(strcmp(argv[i], "--runahead") == 0)
+        {
+            // Without a frame count we pick one from the ROM's measured lag
+            if(i + 1 < argc && argv[i + 1][0] >= '0' && argv[i + 1][0] <= '9')
+                runAheadFrames = atoi(argv[++i]);
+            else
+                runAheadAuto = true;
+        }
+        else
+        {
+            printf("Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    // Overlay and run-ahead report the numbers too, so any of them turns the profiler on
+    myProfiler.enabled = profilePath != nullptr || showOverlay || runAheadFrames > 0 || runAheadAuto;
+    if(profilePath != nullptr)
+    {
+        atexit(dumpProfile);
+#ifdef SIGUSR1
+        signal(SIGUSR1, requestDump);
+#endif
+    }
+
     // Load game
     if(!myChip8.load(argv[1]))
         return 1;
+    profiler::timePoint loaded = profiler::now();
+
+    // Only --cache wants the analysis up front, the debugger builds it the first time it's entered
+    if(cacheDir != nullptr)
+    {
+        printf("ROM load %lld us\n",
+               (long long)std::chrono::duration_cast<std::chrono::microseconds>(loaded - startup).count());
+        prepareAnalysis();
+    }
+
+    if(runAheadAuto)
+    {
+        int lag = measureInputLag(myChip8);
+        // The frame that first shows the key is lag, everything before it is what we can hide
+        runAheadFrames = lag > 1 ? lag - 1 : 0;
+        printf("Measured input lag: %d frames\n", lag);
+        if(lag == 0)
+            printf("Run-ahead disabled: no key changed the screen while measuring\n");
+        else if(lag == 1)
+            printf("Run-ahead disabled: the game already shows key presses on the next frame\n");
+    }
+    if(runAheadFrames > MAX_RUNAHEAD_FRAMES)
+        runAheadFrames = MAX_RUNAHEAD_FRAMES;
+    if(runAheadFrames > 0)
+    {
+        printf("Running %d frames ahead\n", runAheadFrames);
+        atexit(reportRunAhead);
+    }
 
     // Setup OpenGL
     glutInit(&argc, argv);
@@ -53,6 +150,7 @@ int main(int argc, char **argv)
     glutInitWindowSize(display_width, display_height);
     glutInitWindowPosition(320, 320);
     glutCreateWindow("CHIP8 EMULATOR!!");
+    glutIgnoreKeyRepeat(1);     // key[] stays set while held, repeats would only add noise
 
     glutDisplayFunc(display);
     glutIdleFunc(display);
@@ -92,6 +190,8 @@ void setupTexture()
 
 void updateTexture(const c8& c8)
 {
+    profiler::timePoint start = myProfiler.stamp();
+
     // Update pixels
     for(int y = 0; y < 32; ++y)
         for(int x = 0; x < 64; ++x)
@@ -100,6 +200,9 @@ void updateTexture(const c8& c8)
             else
                 screenData[y][x][0] = screenData[y][x][1] = screenData[y][x][2] = 255;  // Enabled
 
+    profiler::timePoint converted = myProfiler.stamp();
+    myProfiler.record(PHASE_CONVERT, start, converted);
+
     // Update Texture
     glTexSubImage2D(GL_TEXTURE_2D, 0 ,0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, (GLvoid*)screenData);
 
@@ -109,6 +212,8 @@ void updateTexture(const c8& c8)
     glTexCoord2d(1.0, 1.0); 	glVertex2d(display_width, display_height);
     glTexCoord2d(0.0, 1.0); 	glVertex2d(0.0,			  display_height);
     glEnd();
+
+    myProfiler.record(PHASE_UPLOAD, converted, myProfiler.stamp());
 }
 
 // Old gfx code
@@ -139,27 +244,169 @@ void updateQuads(const c8& c8)
 
 void display()
 {
-    myChip8.emulateCycle();
+    if(dumpRequested)
+    {
+        dumpRequested = 0;
+        dumpProfile();
+    }
+
+    // Break into the debugger before the next instruction
+    if(debugBreak)
+    {
+        debugBreak = false;
+        profiler::timePoint pauseStart = myProfiler.stamp();
+        prepareAnalysis();
+        myDebugger.pause();
+        myDebugger.console();
+        myProfiler.paused(pauseStart, myProfiler.stamp());
+    }
+
+    if(myDebugger.attached())
+    {
+        if(myDebugger.cycle() != STOP_NONE)
+        {
+            profiler::timePoint pauseStart = myProfiler.stamp();
+            myDebugger.console();
+            myProfiler.paused(pauseStart, myProfiler.stamp());
+        }
+    }
+    else
+        myChip8.emulateCycle();
+    myProfiler.instruction();
 
     if(myChip8.drawFlag)
     {
+        myProfiler.frameReady(myProfiler.stamp());
+
+        // Show the predicted frame, myChip8 itself stays where it is
+        const c8 *shown = &myChip8;
+        if(runAheadFrames > 0)
+        {
+            profiler::timePoint aheadStart = myProfiler.stamp();
+            runAhead(myChip8, aheadChip8, runAheadFrames);
+            myProfiler.record(PHASE_RUNAHEAD, aheadStart, myProfiler.stamp());
+            shown = &aheadChip8;
+        }
+
         // Clear framebuffer
         glClear(GL_COLOR_BUFFER_BIT);
 
 #ifdef DRAWWITHTEXTURE
-        updateTexture(myChip8);
+        updateTexture(*shown);
 #else
-        updateQuads(myChip8);
+        updateQuads(*shown);
 #endif
 
+        if(showOverlay)
+            drawOverlay();
+
         // Swap buffers!
+        profiler::timePoint presentStart = myProfiler.stamp();
         glutSwapBuffers();
+        profiler::timePoint presentEnd = myProfiler.stamp();
+        myProfiler.record(PHASE_PRESENT, presentStart, presentEnd);
+        myProfiler.framePresented(presentEnd);
 
         // Processed frame
         myChip8.drawFlag = false;
     }
 }
 
+void drawOverlay()
+{
+    char line[128];
+    int length = snprintf(line, sizeof(line), "%u ins/frame  p50 %.2f ms  p99 %.2f ms",
+                          myProfiler.lastInstructions(),
+                          myProfiler.phases[PHASE_FRAME].percentile(50) / 1e6,
+                          myProfiler.phases[PHASE_FRAME].percentile(99) / 1e6);
+    if(runAheadFrames > 0)
+        snprintf(line + length, sizeof(line) - length, "  ahead +%.2f ms",
+                 myProfiler.phases[PHASE_RUNAHEAD].percentile(50) / 1e6);
+
+    // Plain colored text on top of the texture, then back to white so the quad isn't tinted next frame
+    glDisable(GL_TEXTURE_2D);
+    glColor3f(1.0f, 1.0f, 0.0f);
+    glRasterPos2i(4, 14);
+    for(const char *c = line; *c; ++c)
+        glutBitmapCharacter(GLUT_BITMAP_8_BY_13, *c);
+    glColor3f(1.0f, 1.0f, 1.0f);
+#ifdef DRAWWITHTEXTURE
+    glEnable(GL_TEXTURE_2D);
+#endif
+}
+
+void dumpProfile()
+{
+    if(profilePath == nullptr)
+        return;
+
+    if(myProfiler.writeJson(profilePath))
+        printf("Wrote frame timings to %s\n", profilePath);
+    else
+        std::cerr << "Was unable to write frame timings to " << profilePath << std::endl;
+}
+
+// A warm start maps the analysis from the last run, a cold start does it and leaves it for the next one.
+// Decoding, mapping and writing the cache are timed on their own
+void prepareAnalysis()
+{
+    if(analysisReady)
+        return;
+    analysisReady = true;
+
+    profiler::timePoint start = profiler::now();
+    std::string path;
+    bool warm = false;
+    if(cacheDir != nullptr)
+    {
+        path = analysis::cachePath(cacheDir, myChip8.rom(), myChip8.romLength());
+        warm = myAnalysis.loadCache(path.c_str(), myChip8.rom(), myChip8.romLength());
+    }
+    if(!warm)
+        myAnalysis.analyze(myChip8.rom(), myChip8.romLength());
+    profiler::timePoint analyzed = profiler::now();
+
+    bool saved = false;
+    if(!warm && cacheDir != nullptr)
+    {
+        saved = myAnalysis.saveCache(path.c_str(), myChip8.rom(), myChip8.romLength());
+        if(!saved)
+            std::cerr << "Was unable to write analysis cache " << path << std::endl;
+    }
+    profiler::timePoint written = profiler::now();
+
+    myDebugger.useAnalysis(&myAnalysis);
+
+    if(cacheDir != nullptr)
+    {
+        long long analysisUs = (long long)std::chrono::duration_cast<std::chrono::microseconds>(analyzed - start).count();
+        if(warm)
+            printf("Warm start: mapped analysis in %lld us (%u blocks, %u jump targets)\n", analysisUs,
+                   myAnalysis.blockCount, myAnalysis.targetCount);
+        else
+            printf("Cold start: analyzed in %lld us (%u blocks, %u jump targets), cache write %lld us%s\n", analysisUs,
+                   myAnalysis.blockCount, myAnalysis.targetCount,
+                   (long long)std::chrono::duration_cast<std::chrono::microseconds>(written - analyzed).count(),
+                   saved ? "" : " (failed)");
+    }
+}
+
+void reportRunAhead()
+{
+    const histogram& ahead = myProfiler.phases[PHASE_RUNAHEAD];
+    if(ahead.count == 0)
+        return;
+
+    printf("Run-ahead %d frames: +%.3f ms CPU per frame on average, p99 +%.3f ms\n", runAheadFrames,
+           (double)ahead.sum / ahead.count / 1e6, ahead.percentile(99) / 1e6);
+}
+
+// Only sets a flag, the file is written from display() outside of the signal handler
+void requestDump(int signum)
+{
+    dumpRequested = 1;
+}
+
 void reshape_window(GLsizei w, GLsizei h)
 {
     glClearColor(0.0f, 0.0f, 0.5f, 0.0f);
@@ -179,6 +426,23 @@ void keyboardDown(unsigned char key, int x, int y)
     if(key == 27)    // esc
         exit(0);
 
+    if(key == 'p')   // pause in the debugger
+    {
+        debugBreak = true;
+        return;
+    }
+
+    if(key == 'o')   // toggle timing overlay
+    {
+        showOverlay = !showOverlay;
+        myProfiler.enabled = myProfiler.enabled || showOverlay;
+        return;
+    }
+
+    // Only a mapped key going down starts a latency sample, not other keys or auto-repeat
+    unsigned char before[16];
+    memcpy(before, myChip8.key, sizeof(before));
+
     if(key == '1')		myChip8.key[0x1] = 1;
     else if(key == '2')	myChip8.key[0x2] = 1;
     else if(key == '3')	myChip8.key[0x3] = 1;
@@ -199,6 +463,9 @@ void keyboardDown(unsigned char key, int x, int y)
     else if(key == 'c')	myChip8.key[0xB] = 1;
     else if(key == 'v')	myChip8.key[0xF] = 1;
 
+    if(memcmp(before, myChip8.key, sizeof(before)) != 0)
+        myProfiler.keyPressed();
+
     //printf("Press key %c\n", key);
 }
 
@@ -0,0 +1,212 @@
+#include "profiler.h"
+
+const char *phaseNames[PHASE_COUNT] = {
+        "emulate",
+        "convert",
+        "upload",
+        "present",
+        "frame",
+        "input_latency",
+        "runahead"
+};
+
+static int log2Floor(uint64_t value) {
+    /* position of the highest set bit, value must not be 0 */
+    int bit = 0;
+    if(value >> 32) { value >>= 32; bit += 32; }
+    if(value >> 16) { value >>= 16; bit += 16; }
+    if(value >> 8)  { value >>= 8;  bit += 8; }
+    if(value >> 4)  { value >>= 4;  bit += 4; }
+    if(value >> 2)  { value >>= 2;  bit += 2; }
+    if(value >> 1)  { bit += 1; }
+    return bit;
+}
+
+histogram::histogram() {
+    reset();
+}
+
+void histogram::reset() {
+    count = 0;
+    min = 0;
+    max = 0;
+    sum = 0;
+    for(int i=0; i<BUCKETS; i++) {
+        buckets[i] = 0;
+    }
+}
+
+int histogram::bucketIndex(uint64_t value) {
+    if(value < SUB_BUCKETS) {
+        return (int) value;     /* small values are exact */
+    }
+    int magnitude = log2Floor(value);
+    int shift = magnitude - SUB_BUCKET_BITS;
+    int sub = (int) ((value >> shift) & (SUB_BUCKETS - 1));   /* the 4 bits right below the highest one */
+    return (shift + 1) * SUB_BUCKETS + sub;
+}
+
+uint64_t histogram::bucketLow(int index) {
+    if(index < SUB_BUCKETS) {
+        return (uint64_t) index;
+    }
+    int shift = index / SUB_BUCKETS - 1;
+    uint64_t sub = (uint64_t) (index % SUB_BUCKETS);
+    return (SUB_BUCKETS + sub) << shift;
+}
+
+uint64_t histogram::bucketHigh(int index) {
+    if(index < SUB_BUCKETS) {
+        return (uint64_t) index;
+    }
+    int shift = index / SUB_BUCKETS - 1;
+    return bucketLow(index) + ((uint64_t) 1 << shift) - 1;
+}
+
+void histogram::record(uint64_t value) {
+    buckets[bucketIndex(value)]++;
+    if(count == 0 || value < min) {
+        min = value;
+    }
+    if(value > max) {
+        max = value;
+    }
+    count++;
+    sum += value;
+}
+
+uint64_t histogram::percentile(double p) const {
+    if(count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t) (p / 100.0 * count + 0.5);
+    if(rank < 1) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for(int i=0; i<BUCKETS; i++) {
+        seen += buckets[i];
+        if(seen >= rank) {
+            uint64_t high = bucketHigh(i);
+            return high < max ? high : max;    /* never report more than we've actually seen */
+        }
+    }
+    return max;
+}
+
+void histogram::writeJson(FILE *out, const char *unit) const {
+    fprintf(out, "{\"unit\": \"%s\", \"count\": %llu, \"min\": %llu, \"max\": %llu, \"mean\": %.1f, ",
+            unit, (unsigned long long) count, (unsigned long long) min, (unsigned long long) max,
+            count ? (double) sum / count : 0.0);
+    fprintf(out, "\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, ",
+            (unsigned long long) percentile(50), (unsigned long long) percentile(90),
+            (unsigned long long) percentile(99), (unsigned long long) percentile(99.9));
+
+    /* only the non-empty buckets, as [low, high, count] */
+    fprintf(out, "\"buckets\": [");
+    bool first = true;
+    for(int i=0; i<BUCKETS; i++) {
+        if(buckets[i] == 0) {
+            continue;
+        }
+        fprintf(out, "%s[%llu, %llu, %llu]", first ? "" : ", ",
+                (unsigned long long) bucketLow(i), (unsigned long long) bucketHigh(i),
+                (unsigned long long) buckets[i]);
+        first = false;
+    }
+    fprintf(out, "]}");
+}
+
+profiler::profiler() {
+    enabled = false;
+    havePreviousFrame = false;
+    inputPending = false;
+    frameInstructions = 0;
+    framePausedNs = 0;
+    inputPausedNs = 0;
+    lastFrameInstructions = 0;
+    lastFrameNs = 0;
+}
+
+static uint64_t elapsedNs(profiler::timePoint start, profiler::timePoint end) {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+void profiler::record(phase p, timePoint start, timePoint end) {
+    if(!enabled || start == timePoint()) {     /* start was taken before the profiler got turned on */
+        return;
+    }
+    phases[p].record(elapsedNs(start, end));
+}
+
+void profiler::paused(timePoint start, timePoint end) {
+    if(!enabled || start == timePoint()) {     /* start was taken before the profiler got turned on */
+        return;
+    }
+    uint64_t ns = elapsedNs(start, end);
+    framePausedNs += ns;
+    if(inputPending) {
+        inputPausedNs += ns;
+    }
+}
+
+void profiler::frameReady(timePoint drawStart) {
+    if(!enabled || !havePreviousFrame) {
+        return;
+    }
+    phases[PHASE_EMULATE].record(elapsedNs(previousFrame, drawStart) - framePausedNs);
+}
+
+void profiler::keyPressed() {
+    if(!enabled || inputPending) {
+        return;
+    }
+    inputPending = true;
+    inputSince = now();
+    inputPausedNs = 0;
+}
+
+void profiler::framePresented(timePoint presentEnd) {
+    if(!enabled) {
+        return;
+    }
+
+    instructionsPerFrame.record(frameInstructions);
+    lastFrameInstructions = frameInstructions;
+    frameInstructions = 0;
+
+    if(havePreviousFrame) {
+        lastFrameNs = elapsedNs(previousFrame, presentEnd) - framePausedNs;
+        phases[PHASE_FRAME].record(lastFrameNs);
+    }
+    previousFrame = presentEnd;
+    havePreviousFrame = true;
+    framePausedNs = 0;
+
+    if(inputPending) {
+        phases[PHASE_INPUT_LATENCY].record(elapsedNs(inputSince, presentEnd) - inputPausedNs);
+        inputPending = false;
+    }
+}
+
+bool profiler::writeJson(const char *filepath) const {
+    FILE *out = fopen(filepath, "w");
+    if(out == nullptr) {
+        return false;
+    }
+
+    fprintf(out, "{\n  \"phases\": {\n");
+    for(int i=0; i<PHASE_COUNT; i++) {
+        fprintf(out, "    \"%s\": ", phaseNames[i]);
+        phases[i].writeJson(out, "ns");
+        fprintf(out, "%s\n", i + 1 < PHASE_COUNT ? "," : "");
+    }
+    fprintf(out, "  },\n  \"instructions_per_frame\": ");
+    instructionsPerFrame.writeJson(out, "instructions");
+    fprintf(out, "\n}\n");
+
+    fclose(out);
+    return true;
+}
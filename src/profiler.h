@@ -0,0 +1,95 @@
+#ifndef C8E_PROFILER_H
+#define C8E_PROFILER_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+/* Fixed-bucket histogram in the style of HdrHistogram.
+ * Values below 16 get a bucket each, every power of two above that is split into 16 linear sub-buckets,
+ * so any recorded value is off by at most 1/16 (~6%) and recording is a couple of shifts and an increment. */
+class histogram {
+    public:
+    static const int SUB_BUCKET_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    histogram();
+
+    void reset();
+    void record(uint64_t value);
+    uint64_t percentile(double p) const;    /* p is 0-100, returns the highest value equivalent to the bucket */
+    void writeJson(FILE *out, const char *unit) const;
+
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+
+    private:
+    uint64_t buckets[BUCKETS];
+
+    static int bucketIndex(uint64_t value);
+    static uint64_t bucketLow(int index);
+    static uint64_t bucketHigh(int index);
+};
+
+/* Frame phases we time in the frontend */
+enum phase {
+    PHASE_EMULATE = 0,      /* last presented frame until the core raised drawFlag again */
+    PHASE_CONVERT,          /* expanding gfx[] to RGB in updateTexture() */
+    PHASE_UPLOAD,           /* glTexSubImage2D and drawing the quad */
+    PHASE_PRESENT,          /* glutSwapBuffers() */
+    PHASE_FRAME,            /* time between two presented frames, minus time in the debugger */
+    PHASE_INPUT_LATENCY,    /* key down until the next presented frame */
+    PHASE_RUNAHEAD,         /* extra frames emulated ahead for the presented frame */
+    PHASE_COUNT
+};
+
+/* Per-frame timing instrumentation. Everything is a no-op unless enabled is set,
+ * so the emulator pays for one branch per call when profiling is off. */
+class profiler {
+    public:
+    typedef std::chrono::steady_clock clock;   /* monotonic, never jumps with wall clock changes */
+    typedef clock::time_point timePoint;
+
+    bool enabled;
+    histogram phases[PHASE_COUNT];
+    histogram instructionsPerFrame;
+
+    profiler();
+
+    static timePoint now() { return clock::now(); }
+
+    /* the hot path takes its timestamps here, so profiling off costs a branch and no clock read */
+    timePoint stamp() const { return enabled ? clock::now() : timePoint(); }
+
+    void record(phase p, timePoint start, timePoint end);
+
+    /* one emulateCycle() done, the only per-cycle call so it doesn't touch the clock */
+    void instruction() { if(enabled) frameInstructions++; }
+    void keyPressed();          /* starts an input latency measurement if none is pending */
+    void paused(timePoint start, timePoint end);    /* time spent in the debugger, left out of every phase */
+    void frameReady(timePoint drawStart);           /* the core raised drawFlag, closes the emulate phase */
+    void framePresented(timePoint presentEnd);      /* closes the current frame */
+
+    double lastFrameMs() const { return lastFrameNs / 1e6; }
+    unsigned int lastInstructions() const { return lastFrameInstructions; }
+
+    bool writeJson(const char *filepath) const;
+
+    private:
+    bool havePreviousFrame;
+    timePoint previousFrame;
+    bool inputPending;
+    timePoint inputSince;
+    unsigned int frameInstructions;
+    uint64_t framePausedNs;     /* debugger time since the previous frame */
+    uint64_t inputPausedNs;     /* debugger time since the pending key press */
+    unsigned int lastFrameInstructions;
+    uint64_t lastFrameNs;
+};
+
+extern const char *phaseNames[PHASE_COUNT];
+
+#endif //C8E_PROFILER_H
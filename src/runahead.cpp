@@ -0,0 +1,78 @@
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "runahead.h"
+
+/* Lag is sampled at several points of the game. Between samples we keep playing on the copy where a key
+ * made a difference, so title screens waiting for a key get dismissed instead of being measured over and over.
+ * The median of the samples is what the game usually does, one quick title screen doesn't decide it. */
+#define LAG_WARMUP_FRAMES 30
+#define LAG_SAMPLES 8
+#define LAG_PRESS_FRAMES 10
+
+bool emulateFrame(c8 &machine) {
+    machine.drawFlag = false;
+    for(int i=0; i<MAX_CYCLES_PER_FRAME; i++) {
+        machine.emulateCycle();
+        if(machine.drawFlag) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void runAhead(const c8 &machine, c8 &ahead, int frames) {
+    ahead = machine;    /* save state, the real machine is our rollback point */
+    for(int i=0; i<frames; i++) {
+        emulateFrame(ahead);
+    }
+}
+
+int measureInputLag(const c8 &machine) {
+    std::vector<int> lags;
+    c8 sample = machine;
+
+    for(int s=0; s<LAG_SAMPLES; s++) {
+        for(int f=0; f<LAG_WARMUP_FRAMES; f++) {
+            emulateFrame(sample);
+        }
+
+        /* hold down each key on one copy and nothing on the other, the first frame they differ is the lag */
+        int lag = 0;
+        int reactingKey = -1;
+        for(int k=0; k<16; k++) {
+            c8 idle = sample;
+            c8 pressed = sample;
+            memset(idle.key, 0, sizeof(idle.key));
+            memset(pressed.key, 0, sizeof(pressed.key));
+            pressed.key[k] = 1;
+
+            for(int f=1; f<=MAX_RUNAHEAD_FRAMES + 1 && (lag == 0 || f < lag); f++) {
+                emulateFrame(idle);
+                emulateFrame(pressed);
+                if(memcmp(idle.gfx, pressed.gfx, sizeof(idle.gfx)) != 0) {
+                    lag = f;
+                    reactingKey = k;
+                    break;
+                }
+            }
+        }
+        if(lag == 0) {
+            continue;
+        }
+        lags.push_back(lag);
+
+        /* play on with that key held for a moment, then let go again */
+        sample.key[reactingKey] = 1;
+        for(int f=0; f<LAG_PRESS_FRAMES; f++) {
+            emulateFrame(sample);
+        }
+        memset(sample.key, 0, sizeof(sample.key));
+    }
+
+    if(lags.empty()) {
+        return 0;
+    }
+    std::sort(lags.begin(), lags.end());
+    return lags[lags.size() / 2];
+}
@@ -0,0 +1,26 @@
+#ifndef C8E_RUNAHEAD_H
+#define C8E_RUNAHEAD_H
+
+#include "c8.h"
+
+/* Run-ahead hides the frames a game waits before reacting to a key.
+ * Every presented frame we save the machine, emulate k frames ahead with the current keys,
+ * show that predicted frame and roll back, so the real machine never sees the extra frames. */
+
+/* A frame is everything the core does until it raises drawFlag.
+ * Games waiting on 0xFX0A never draw, so we give up after this many cycles. */
+#define MAX_CYCLES_PER_FRAME 1024
+#define MAX_RUNAHEAD_FRAMES 4
+
+/* Runs machine until its next frame. Returns false if it didn't draw within MAX_CYCLES_PER_FRAME. */
+bool emulateFrame(c8 &machine);
+
+/* Saves machine into ahead and emulates frames frames ahead of it. machine itself is left untouched. */
+void runAhead(const c8 &machine, c8 &ahead, int frames);
+
+/* Frames between holding down a key and the screen first showing it, the median over several points of the game.
+ * Measured on copies of machine.
+ * Returns 0 if no key changed anything within MAX_RUNAHEAD_FRAMES + 1 frames. */
+int measureInputLag(const c8 &machine);
+
+#endif //C8E_RUNAHEAD_H